@@ -11,8 +11,14 @@
 #include <Graphics/GraphicsEngine/interface/RenderDevice.h>
 #include <Graphics/GraphicsEngine/interface/ShaderResourceBinding.h>
 #include <Graphics/GraphicsEngine/interface/SwapChain.h>
+#include <Graphics/GraphicsTools/interface/ScopedQueryHelper.hpp>
+#include <test/upload.hpp>
 
+#include <array>
 #include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
 struct GLFWwindow;
 
@@ -21,11 +27,32 @@ namespace test {
 	using TClock = std::chrono::high_resolution_clock;
 	using TSeconds = std::chrono::duration<float>;
 
+	// Element of TestGame::_vertexPool, layout matches the one we defined in the pipeline state
+	struct ColorVertex {
+		Diligent::float3 pos;
+		Diligent::float4 color;
+	};
+
+	// Ranges inside the shared geometry pools, only drawn once every upload finished
+	struct Mesh {
+		BufferRange vertices = {};
+		BufferRange positions = {};
+		BufferRange indices = {};
+		bool ready = false;
+	};
+
+	struct CubeInstance {
+		Diligent::float3 position = {};
+		Diligent::float4x4 worldViewProj = {};
+		float viewDepth = 0.F;
+	};
+
 	class TestGame {
 	protected:
 		bool _initialized = false;
 
 		GLFWwindow* _handle = nullptr;
+		std::string _title;
 
 		Diligent::RefCntAutoPtr<Diligent::IRenderDevice> _pDevice;
 		Diligent::RefCntAutoPtr<Diligent::IDeviceContext> _pImmediateContext;
@@ -36,12 +63,55 @@ namespace test {
 		Diligent::RefCntAutoPtr<Diligent::IPipelineState> _pPSO;
 		Diligent::RefCntAutoPtr<Diligent::IShaderResourceBinding> _pSRB;
 
-		Diligent::RefCntAutoPtr<Diligent::IBuffer> _CubeVertexBuffer;
-		Diligent::RefCntAutoPtr<Diligent::IBuffer> _CubeIndexBuffer;
-		Diligent::RefCntAutoPtr<Diligent::IBuffer> _VSConstants;
+		// Main pass variant used after the depth prepass (COMPARISON_FUNC_EQUAL, no depth writes)
+		Diligent::RefCntAutoPtr<Diligent::IPipelineState> _pEqualPSO;
+		Diligent::RefCntAutoPtr<Diligent::IShaderResourceBinding> _pEqualSRB;
+
+		// Position only, no color targets
+		Diligent::RefCntAutoPtr<Diligent::IPipelineState> _pDepthPSO;
+		Diligent::RefCntAutoPtr<Diligent::IShaderResourceBinding> _pDepthSRB;
 
-		Diligent::float4x4 _WorldViewProjMatrix;
+		// Overdraw visualization (additive), with and without prepass
+		Diligent::RefCntAutoPtr<Diligent::IPipelineState> _pOverdrawPSO;
+		Diligent::RefCntAutoPtr<Diligent::IShaderResourceBinding> _pOverdrawSRB;
+		Diligent::RefCntAutoPtr<Diligent::IPipelineState> _pOverdrawEqualPSO;
+		Diligent::RefCntAutoPtr<Diligent::IShaderResourceBinding> _pOverdrawEqualSRB;
 
+		Diligent::RefCntAutoPtr<Diligent::IBuffer> _VSConstants;
+
+		// STREAMING ---
+		std::unique_ptr<UploadManager> _upload;
+		std::unique_ptr<BufferPool> _vertexPool;   // Position + color
+		std::unique_ptr<BufferPool> _positionPool; // Position only, for the depth prepass
+		std::unique_ptr<BufferPool> _indexPool;
+
+		Mesh _cubeMesh = {};
+
+		// Procedural terrain streamed in and out at runtime (F4)
+		Mesh _terrainMesh = {};
+		bool _terrainStreamed = false;
+		std::optional<std::array<uint64_t, 3>> _poolUsedBeforeTerrain = std::nullopt; // Vertex, position, index pool usage, checked once the terrain retires
+		// -------------
+
+		Diligent::float4x4 _ViewProjMatrix;
+		std::vector<CubeInstance> _cubes = {};
+		std::vector<size_t> _drawOrder = {};
+
+		// RENDER MODES ---
+		bool _depthPrepass = false;  // F1, off by default since the EQUAL depth test relies on matching position output
+		bool _debugOverdraw = false; // F2
+		bool _sortOpaque = true;     // F3
+		bool _streamTerrain = false; // F4, handled in update()
+
+		// Counts pixel shader invocations of the color pass, used to report overdraw
+		std::unique_ptr<Diligent::ScopedQueryHelper> _pPipelineStats;
+		uint64_t _psInvocations = 0;
+		float _statsTimer = 0.F;
+
+		// Upload totals over the current stats window, averaged per frame in the title
+		uint32_t _statsFrames = 0;
+		uint64_t _statsUploadBytes = 0;
+		uint64_t _statsUploadCopies = 0;
 		// ------------------------
 
 		TClock::time_point _lastUpdate = {};
@@ -53,7 +123,14 @@ namespace test {
 		void createEngine(Diligent::RENDER_DEVICE_TYPE type);
 
 		// TEST --------------------
+		void createStreaming();
 		void createCube();
+		void streamTerrain();
+		void checkTerrainRelease();
+		void createPipeline(const char* name, Diligent::IShader* pVS, Diligent::IShader* pPS, const std::vector<Diligent::LayoutElement>& layout, bool depthEqual, bool additive, Diligent::RefCntAutoPtr<Diligent::IPipelineState>& pso, Diligent::RefCntAutoPtr<Diligent::IShaderResourceBinding>& srb);
+
+		void sortOpaque();
+		void updateStats(float dt);
 
 		[[nodiscard]] Diligent::float4x4 GetSurfacePretransformMatrix(const Diligent::float3& f3CameraViewAxis) const;
 		[[nodiscard]] Diligent::float4x4 GetAdjustedProjectionMatrix(float FOV, float NearPlane, float FarPlane) const;
@@ -64,7 +141,10 @@ namespace test {
 		void shutdown();
 
 		static void callbacks_resize(GLFWwindow* whandle, int width, int height);
+		static void callbacks_key(GLFWwindow* whandle, int key, int scancode, int action, int mods);
 
 		void draw();
+		void drawScene(bool positionOnly);
+		void drawMesh(const Mesh& mesh, const Diligent::float4x4& worldViewProj, bool positionOnly);
 	};
 } // namespace test
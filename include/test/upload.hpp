@@ -0,0 +1,138 @@
+#pragma once
+
+#include <Common/interface/RefCntAutoPtr.hpp>
+
+#include <Graphics/GraphicsEngine/interface/Buffer.h>
+#include <Graphics/GraphicsEngine/interface/DeviceContext.h>
+#include <Graphics/GraphicsEngine/interface/Fence.h>
+#include <Graphics/GraphicsEngine/interface/RenderDevice.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace test {
+
+	// Range inside a BufferPool, in elements (not bytes)
+	struct BufferRange {
+		uint64_t offset = 0;
+		uint64_t size = 0;
+
+		[[nodiscard]] bool valid() const { return this->size != 0; }
+	};
+
+	// One big GPU buffer shared by many meshes, so draws keep the same bindings
+	// and only change BaseVertex / FirstIndexLocation. Uses a first-fit free-list that
+	// merges neighbours on release. Sizes are in elements of `stride` bytes, which keeps
+	// every allocation aligned for BaseVertex.
+	class BufferPool {
+	protected:
+		Diligent::RefCntAutoPtr<Diligent::IBuffer> _buffer;
+
+		uint32_t _stride = 0;
+		uint64_t _capacity = 0;
+		uint64_t _used = 0;
+
+		std::map<uint64_t, uint64_t> _free = {}; // offset -> size
+
+	public:
+		BufferPool(Diligent::IRenderDevice* device, const char* name, Diligent::BIND_FLAGS bindFlags, uint32_t stride, uint64_t capacity);
+
+		// Returns an invalid range when no free block is big enough
+		[[nodiscard]] BufferRange allocate(uint64_t count);
+		void free(const BufferRange& range);
+
+		[[nodiscard]] Diligent::IBuffer* buffer() const { return this->_buffer; }
+		[[nodiscard]] uint32_t stride() const { return this->_stride; }
+		[[nodiscard]] uint64_t capacity() const { return this->_capacity; }
+		[[nodiscard]] uint64_t used() const { return this->_used; }
+
+		// 0 = all free space is one block, close to 1 = free space is scattered in small holes
+		[[nodiscard]] float fragmentation() const;
+	};
+
+	struct UploadStats {
+		size_t queueDepth = 0;    // Uploads waiting or partially copied
+		uint64_t queuedBytes = 0; // Bytes still waiting to be copied
+		uint64_t bytesLastFrame = 0;
+		uint32_t copiesLastFrame = 0;
+		uint64_t stagingInFlight = 0; // Staging bytes the GPU has not consumed yet
+	};
+
+	// Streams data into GPU buffers through a ring of persistent staging buffers, one per frame in flight.
+	// Every flush() fills the next staging buffer with at most `frameBudget` bytes, merges adjacent
+	// copies into a single CopyBuffer and signals a fence. A staging buffer is only mapped again once
+	// the GPU passed its fence, and released pool ranges are only reused after the same check.
+	class UploadManager {
+	protected:
+		struct PendingUpload {
+			Diligent::RefCntAutoPtr<Diligent::IBuffer> dst;
+			uint64_t dstOffset = 0;
+			std::vector<uint8_t> data = {};
+			uint64_t copied = 0;
+			std::function<void()> onComplete = nullptr;
+		};
+
+		struct CopyRegion {
+			Diligent::IBuffer* dst = nullptr;
+			uint64_t srcOffset = 0;
+			uint64_t dstOffset = 0;
+			uint64_t size = 0;
+		};
+
+		struct StagingBuffer {
+			Diligent::RefCntAutoPtr<Diligent::IBuffer> buffer;
+			uint64_t fenceValue = 0; // Signalled after the last copy out of this buffer
+			uint64_t bytes = 0;
+		};
+
+		struct DeferredRelease {
+			uint64_t fenceValue = 0;
+			BufferPool* pool = nullptr;
+			BufferRange range = {};
+		};
+
+		Diligent::RefCntAutoPtr<Diligent::IDeviceContext> _context;
+		Diligent::RefCntAutoPtr<Diligent::IFence> _fence;
+		uint64_t _fenceValue = 0;     // Last value enqueued for signal
+		uint64_t _completedValue = 0; // Last value the GPU reached, updated by retire()
+
+		// STAGING ---
+		std::vector<StagingBuffer> _staging = {};
+		size_t _stagingIndex = 0; // Next buffer to fill, round robin so it is always the oldest
+		Diligent::MAP_FLAGS _mapFlags = Diligent::MAP_FLAG_NONE;
+		// -----------
+
+		uint64_t _frameBudget = 0;
+
+		std::deque<PendingUpload> _queue = {};
+		std::deque<DeferredRelease> _releases = {};
+		std::vector<CopyRegion> _regions = {};
+
+		UploadStats _stats = {};
+
+		void retire();
+		[[nodiscard]] uint8_t* mapStaging(StagingBuffer& staging);
+
+	public:
+		UploadManager(Diligent::IRenderDevice* device, Diligent::IDeviceContext* context, uint64_t frameBudget, uint32_t framesInFlight = 3);
+
+		// Data is copied, the caller can free it right away. `onComplete` runs once the last
+		// byte has been recorded, draws issued after that on the same context see the data.
+		void upload(Diligent::IBuffer* dst, uint64_t dstOffset, const void* data, uint64_t size, std::function<void()> onComplete = nullptr);
+		// `size` is in bytes and must cover the whole range
+		void upload(const BufferPool& pool, const BufferRange& range, const void* data, uint64_t size, std::function<void()> onComplete = nullptr);
+
+		// Queued uploads into the range are cancelled. The range goes back to the pool
+		// once frames that may still draw from it are done
+		void release(BufferPool& pool, const BufferRange& range);
+
+		// Call once per frame, before drawing
+		void flush();
+
+		[[nodiscard]] const UploadStats& stats() const { return this->_stats; }
+		[[nodiscard]] size_t pendingReleases() const { return this->_releases.size(); }
+	};
+} // namespace test
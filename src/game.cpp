@@ -67,14 +67,18 @@
 #endif //
 
 #include <Graphics/GraphicsTools/interface/MapHelper.hpp>
+#include <Graphics/GraphicsTools/interface/ShaderMacroHelper.hpp>
 #include <Platforms/Basic/interface/DebugUtilities.hpp>
 #include <test/game.hpp>
 
 #include <GLFW/glfw3native.h>
 
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <cmath>
+#include <iomanip>
+#include <sstream>
 #include <thread>
 
 using namespace std::chrono_literals;
@@ -127,7 +131,8 @@ namespace test {
 		}
 #endif
 
-		this->createWindow(APIHint, "Test (" + engine + ")");
+		this->_title = "Test (" + engine + ")";
+		this->createWindow(APIHint, this->_title);
 		this->createEngine(devType);
 		this->initGame();
 	}
@@ -151,6 +156,7 @@ namespace test {
 		glfwSetWindowUserPointer(window, this);
 		glfwSetWindowSizeLimits(window, 320, 240, GLFW_DONT_CARE, GLFW_DONT_CARE);
 		glfwSetWindowSizeCallback(GLFWHANDLE, callbacks_resize);
+		glfwSetKeyCallback(GLFWHANDLE, callbacks_key);
 	}
 
 	void TestGame::callbacks_resize(GLFWwindow* whandle, int width, int height) {
@@ -160,6 +166,27 @@ namespace test {
 		window._pSwapChain->Resize(width, height);
 	}
 
+	void TestGame::callbacks_key(GLFWwindow* whandle, int key, int /*scancode*/, int action, int /*mods*/) {
+		if (action != GLFW_PRESS) return;
+		auto& window = glfwHandleToRenderer(whandle);
+
+		switch (key) {
+			case GLFW_KEY_F1:
+				window._depthPrepass = !window._depthPrepass;
+				break;
+			case GLFW_KEY_F2:
+				window._debugOverdraw = !window._debugOverdraw;
+				break;
+			case GLFW_KEY_F3:
+				window._sortOpaque = !window._sortOpaque;
+				break;
+			case GLFW_KEY_F4:
+				window._streamTerrain = true;
+				break;
+			default: break;
+		}
+	}
+
 	void TestGame::createEngine(Diligent::RENDER_DEVICE_TYPE type) {
 #if PLATFORM_WIN32
 		Diligent::Win32NativeWindow Window{glfwGetWin32Window(GLFWHANDLE)};
@@ -194,6 +221,7 @@ namespace test {
 					this->_pEngineFactory = pFactoryD3D11;
 
 					Diligent::EngineD3D11CreateInfo EngineCI;
+					EngineCI.Features.PipelineStatisticsQueries = Diligent::DEVICE_FEATURE_STATE_OPTIONAL;
 					pFactoryD3D11->CreateDeviceAndContextsD3D11(EngineCI, &this->_pDevice, &this->_pImmediateContext);
 					pFactoryD3D11->CreateSwapChainD3D11(this->_pDevice, this->_pImmediateContext, SCDesc, Diligent::FullScreenModeDesc{}, Window, &this->_pSwapChain);
 				}
@@ -211,6 +239,7 @@ namespace test {
 					this->_pEngineFactory = pFactoryD3D12;
 
 					Diligent::EngineD3D12CreateInfo EngineCI;
+					EngineCI.Features.PipelineStatisticsQueries = Diligent::DEVICE_FEATURE_STATE_OPTIONAL;
 					pFactoryD3D12->CreateDeviceAndContextsD3D12(EngineCI, &this->_pDevice, &this->_pImmediateContext);
 					pFactoryD3D12->CreateSwapChainD3D12(this->_pDevice, this->_pImmediateContext, SCDesc, Diligent::FullScreenModeDesc{}, Window, &this->_pSwapChain);
 				}
@@ -230,6 +259,7 @@ namespace test {
 					this->_pEngineFactory = pFactoryOpenGL;
 
 					Diligent::EngineGLCreateInfo EngineCI;
+					EngineCI.Features.PipelineStatisticsQueries = Diligent::DEVICE_FEATURE_STATE_OPTIONAL;
 					EngineCI.Window = Window;
 					pFactoryOpenGL->CreateDeviceAndSwapChainGL(EngineCI, &this->_pDevice, &this->_pImmediateContext, SCDesc, &this->_pSwapChain);
 				}
@@ -249,6 +279,7 @@ namespace test {
 					this->_pEngineFactory = pFactoryVk;
 
 					Diligent::EngineVkCreateInfo EngineCI;
+					EngineCI.Features.PipelineStatisticsQueries = Diligent::DEVICE_FEATURE_STATE_OPTIONAL;
 					pFactoryVk->CreateDeviceAndContextsVk(EngineCI, &this->_pDevice, &this->_pImmediateContext);
 					pFactoryVk->CreateSwapChainVk(this->_pDevice, this->_pImmediateContext, SCDesc, Window, &this->_pSwapChain);
 				}
@@ -278,32 +309,6 @@ namespace test {
 	// -----------------------------------------------------------
 
 	void TestGame::initGame() {
-		// Pipeline state object encompasses configuration of all GPU stages
-
-		Diligent::GraphicsPipelineStateCreateInfo PSOCreateInfo;
-
-		// Pipeline state name is used by the engine to report issues.
-		// It is always a good idea to give objects descriptive names.
-		PSOCreateInfo.PSODesc.Name = "Cube PSO";
-
-		// This is a graphics pipeline
-		PSOCreateInfo.PSODesc.PipelineType = Diligent::PIPELINE_TYPE_GRAPHICS;
-
-		// clang-format off
-    // This tutorial will render to a single render target
-    PSOCreateInfo.GraphicsPipeline.NumRenderTargets             = 1;
-    // Set render target format which is the format of the swap chain's color buffer
-    PSOCreateInfo.GraphicsPipeline.RTVFormats[0]                = this->_pSwapChain->GetDesc().ColorBufferFormat;
-    // Set depth buffer format which is the format of the swap chain's back buffer
-    PSOCreateInfo.GraphicsPipeline.DSVFormat                    = this->_pSwapChain->GetDesc().DepthBufferFormat;
-    // Primitive topology defines what kind of primitives will be rendered by this pipeline state
-    PSOCreateInfo.GraphicsPipeline.PrimitiveTopology            = Diligent::PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    // Cull back faces
-    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.CullMode      = Diligent::CULL_MODE_BACK;
-    // Enable depth testing
-    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthEnable = true;
-		// clang-format on
-
 		Diligent::ShaderCreateInfo ShaderCI;
 		// Tell the system that the shader source code is in HLSL.
 		// For OpenGL, the engine will convert this into GLSL under the hood.
@@ -336,6 +341,21 @@ namespace test {
 			this->_pDevice->CreateBuffer(CBDesc, nullptr, &this->_VSConstants);
 		}
 
+		// Create the depth prepass vertex shader, same source built to only read positions
+		Diligent::RefCntAutoPtr<Diligent::IShader> pDepthVS;
+		{
+			Diligent::ShaderMacroHelper Macros;
+			Macros.AddShaderMacro("DEPTH_ONLY", 1);
+
+			ShaderCI.Desc.ShaderType = Diligent::SHADER_TYPE_VERTEX;
+			ShaderCI.EntryPoint = "main";
+			ShaderCI.Desc.Name = "Cube depth VS";
+			ShaderCI.FilePath = "cube.vsh";
+			ShaderCI.Macros = Macros;
+			this->_pDevice->CreateShader(ShaderCI, &pDepthVS);
+			ShaderCI.Macros = {};
+		}
+
 		// Create a pixel shader
 		Diligent::RefCntAutoPtr<Diligent::IShader> pPS;
 		{
@@ -346,16 +366,94 @@ namespace test {
 			this->_pDevice->CreateShader(ShaderCI, &pPS);
 		}
 
+		// Create the overdraw visualization pixel shader
+		Diligent::RefCntAutoPtr<Diligent::IShader> pOverdrawPS;
+		{
+			ShaderCI.Desc.ShaderType = Diligent::SHADER_TYPE_PIXEL;
+			ShaderCI.EntryPoint = "main";
+			ShaderCI.Desc.Name = "Cube overdraw PS";
+			ShaderCI.FilePath = "overdraw.psh";
+			this->_pDevice->CreateShader(ShaderCI, &pOverdrawPS);
+		}
+
 		// Define vertex shader input layout
-		std::array<Diligent::LayoutElement, 2> LayoutElems =
+		const std::vector<Diligent::LayoutElement> LayoutElems =
 		    {
 			// Attribute 0 - vertex position
 			Diligent::LayoutElement{0, 0, 3, Diligent::VT_FLOAT32, false},
 			// Attribute 1 - vertex color
 			Diligent::LayoutElement{1, 0, 4, Diligent::VT_FLOAT32, false}};
 
-		PSOCreateInfo.GraphicsPipeline.InputLayout.LayoutElements = LayoutElems.data();
-		PSOCreateInfo.GraphicsPipeline.InputLayout.NumElements = static_cast<uint32_t>(LayoutElems.size());
+		// The depth prepass reads a separate, tightly packed position stream
+		const std::vector<Diligent::LayoutElement> DepthLayoutElems =
+		    {
+			// Attribute 0 - vertex position
+			Diligent::LayoutElement{0, 0, 3, Diligent::VT_FLOAT32, false}};
+
+		this->createPipeline("Cube PSO", pVS, pPS, LayoutElems, false, false, this->_pPSO, this->_pSRB);
+		this->createPipeline("Cube equal PSO", pVS, pPS, LayoutElems, true, false, this->_pEqualPSO, this->_pEqualSRB);
+		this->createPipeline("Cube depth PSO", pDepthVS, nullptr, DepthLayoutElems, false, false, this->_pDepthPSO, this->_pDepthSRB);
+		this->createPipeline("Cube overdraw PSO", pVS, pOverdrawPS, LayoutElems, false, true, this->_pOverdrawPSO, this->_pOverdrawSRB);
+		this->createPipeline("Cube overdraw equal PSO", pVS, pOverdrawPS, LayoutElems, true, true, this->_pOverdrawEqualPSO, this->_pOverdrawEqualSRB);
+
+		// Pipeline statistics are optional, overdraw is only reported when the device supports them
+		if (this->_pDevice->GetDeviceInfo().Features.PipelineStatisticsQueries) {
+			Diligent::QueryDesc queryDesc;
+			queryDesc.Name = "Color pass statistics";
+			queryDesc.Type = Diligent::QUERY_TYPE_PIPELINE_STATISTICS;
+			this->_pPipelineStats = std::make_unique<Diligent::ScopedQueryHelper>(this->_pDevice, queryDesc, 2);
+		}
+
+		this->createStreaming();
+		this->createCube();
+	}
+
+	void TestGame::createPipeline(const char* name, Diligent::IShader* pVS, Diligent::IShader* pPS, const std::vector<Diligent::LayoutElement>& layout, bool depthEqual, bool additive, Diligent::RefCntAutoPtr<Diligent::IPipelineState>& pso, Diligent::RefCntAutoPtr<Diligent::IShaderResourceBinding>& srb) {
+		// Pipeline state object encompasses configuration of all GPU stages
+
+		Diligent::GraphicsPipelineStateCreateInfo PSOCreateInfo;
+
+		// Pipeline state name is used by the engine to report issues.
+		// It is always a good idea to give objects descriptive names.
+		PSOCreateInfo.PSODesc.Name = name;
+
+		// This is a graphics pipeline
+		PSOCreateInfo.PSODesc.PipelineType = Diligent::PIPELINE_TYPE_GRAPHICS;
+
+		// Depth only pipelines have no pixel shader and no color targets
+		if (pPS != nullptr) {
+			PSOCreateInfo.GraphicsPipeline.NumRenderTargets = 1;
+			// Set render target format which is the format of the swap chain's color buffer
+			PSOCreateInfo.GraphicsPipeline.RTVFormats[0] = this->_pSwapChain->GetDesc().ColorBufferFormat;
+		}
+
+		// clang-format off
+    // Set depth buffer format which is the format of the swap chain's back buffer
+    PSOCreateInfo.GraphicsPipeline.DSVFormat                    = this->_pSwapChain->GetDesc().DepthBufferFormat;
+    // Primitive topology defines what kind of primitives will be rendered by this pipeline state
+    PSOCreateInfo.GraphicsPipeline.PrimitiveTopology            = Diligent::PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    // Cull back faces
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.CullMode      = Diligent::CULL_MODE_BACK;
+    // Enable depth testing
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthEnable = true;
+		// clang-format on
+
+		if (depthEqual) {
+			// Depth was already written by the prepass, only shade the visible surface
+			PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthFunc = Diligent::COMPARISON_FUNC_EQUAL;
+			PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthWriteEnable = false;
+		}
+
+		if (additive) {
+			auto& RT0 = PSOCreateInfo.GraphicsPipeline.BlendDesc.RenderTargets[0];
+			RT0.BlendEnable = true;
+			RT0.SrcBlend = Diligent::BLEND_FACTOR_ONE;
+			RT0.DestBlend = Diligent::BLEND_FACTOR_ONE;
+			RT0.BlendOp = Diligent::BLEND_OPERATION_ADD;
+		}
+
+		PSOCreateInfo.GraphicsPipeline.InputLayout.LayoutElements = layout.data();
+		PSOCreateInfo.GraphicsPipeline.InputLayout.NumElements = static_cast<uint32_t>(layout.size());
 
 		PSOCreateInfo.pVS = pVS;
 		PSOCreateInfo.pPS = pPS;
@@ -363,26 +461,29 @@ namespace test {
 		// Define variable type that will be used by default
 		PSOCreateInfo.PSODesc.ResourceLayout.DefaultVariableType = Diligent::SHADER_RESOURCE_VARIABLE_TYPE_STATIC;
 
-		this->_pDevice->CreateGraphicsPipelineState(PSOCreateInfo, &this->_pPSO);
+		this->_pDevice->CreateGraphicsPipelineState(PSOCreateInfo, &pso);
+		if (pso == nullptr) throw std::runtime_error(std::string("Failed to create ") + name);
 
 		// Since we did not explcitly specify the type for 'Constants' variable, default
 		// type (SHADER_RESOURCE_VARIABLE_TYPE_STATIC) will be used. Static variables never
 		// change and are bound directly through the pipeline state object.
-		this->_pPSO->GetStaticVariableByName(Diligent::SHADER_TYPE_VERTEX, "Constants")->Set(this->_VSConstants);
+		pso->GetStaticVariableByName(Diligent::SHADER_TYPE_VERTEX, "Constants")->Set(this->_VSConstants);
 
 		// Create a shader resource binding object and bind all static resources in it
-		this->_pPSO->CreateShaderResourceBinding(&this->_pSRB, true);
+		pso->CreateShaderResourceBinding(&srb, true);
+	}
 
-		this->createCube();
+	void TestGame::createStreaming() {
+		// At most 256 KB copied per frame, one staging buffer per frame in flight
+		this->_upload = std::make_unique<UploadManager>(this->_pDevice, this->_pImmediateContext, 256U << 10U);
+
+		// Geometry pools shared by every mesh
+		this->_vertexPool = std::make_unique<BufferPool>(this->_pDevice, "Vertex pool", Diligent::BIND_VERTEX_BUFFER, static_cast<uint32_t>(sizeof(ColorVertex)), 1U << 16U);
+		this->_positionPool = std::make_unique<BufferPool>(this->_pDevice, "Position pool", Diligent::BIND_VERTEX_BUFFER, static_cast<uint32_t>(sizeof(Diligent::float3)), 1U << 16U);
+		this->_indexPool = std::make_unique<BufferPool>(this->_pDevice, "Index pool", Diligent::BIND_INDEX_BUFFER, static_cast<uint32_t>(sizeof(uint32_t)), 1U << 18U);
 	}
 
 	void TestGame::createCube() {
-		// Layout of this structure matches the one we defined in the pipeline state
-		struct Vertex {
-			Diligent::float3 pos;
-			Diligent::float4 color;
-		};
-
 		// Cube vertices
 
 		//      (-1,+1,+1)________________(+1,+1,+1)
@@ -400,7 +501,7 @@ namespace test {
 		//        (-1,-1,-1)       (+1,-1,-1)
 		//
 
-		constexpr Vertex CubeVerts[8] =
+		constexpr ColorVertex CubeVerts[8] =
 		    {
 			{Diligent::float3{-1, -1, -1}, Diligent::float4{1, 0, 0, 1}},
 			{Diligent::float3{-1, +1, -1}, Diligent::float4{0, 1, 0, 1}},
@@ -413,18 +514,12 @@ namespace test {
 			{Diligent::float3{+1, -1, +1}, Diligent::float4{0.2F, 0.2F, 0.2F, 1.F}},
 		    };
 
-		// Create a vertex buffer that stores cube vertices
-		Diligent::BufferDesc VertBuffDesc;
-		VertBuffDesc.Name = "Cube vertex buffer";
-		VertBuffDesc.Usage = Diligent::USAGE_IMMUTABLE;
-		VertBuffDesc.BindFlags = Diligent::BIND_VERTEX_BUFFER;
-		VertBuffDesc.Size = sizeof(CubeVerts);
-
-		Diligent::BufferData VBData;
-		VBData.pData = CubeVerts;
-		VBData.DataSize = sizeof(CubeVerts);
-
-		this->_pDevice->CreateBuffer(VertBuffDesc, &VBData, &this->_CubeVertexBuffer);
+		// POSITIONS ---------------------
+		// Tightly packed positions for the depth prepass, keeps its vertex fetch minimal
+		std::array<Diligent::float3, 8> CubePositions = {};
+		for (size_t i = 0; i < CubePositions.size(); i++)
+			CubePositions[i] = CubeVerts[i].pos;
+		// -------------------------------
 
 		// INDICES -----------------------
 		constexpr uint32_t Indices[] =
@@ -436,21 +531,118 @@ namespace test {
 			1, 5, 2, 5, 6, 2,
 			3, 6, 7, 3, 2, 6};
 
-		Diligent::BufferDesc IndBuffDesc;
-		IndBuffDesc.Name = "Cube index buffer";
-		IndBuffDesc.Usage = Diligent::USAGE_IMMUTABLE;
-		IndBuffDesc.BindFlags = Diligent::BIND_INDEX_BUFFER;
-		IndBuffDesc.Size = sizeof(Indices);
+		// -------------------------------
+
+		// UPLOAD ------------------------
+		this->_cubeMesh.vertices = this->_vertexPool->allocate(std::size(CubeVerts));
+		this->_cubeMesh.positions = this->_positionPool->allocate(CubePositions.size());
+		this->_cubeMesh.indices = this->_indexPool->allocate(std::size(Indices));
+		if (!this->_cubeMesh.vertices.valid() || !this->_cubeMesh.positions.valid() || !this->_cubeMesh.indices.valid()) throw std::runtime_error("Out of geometry pool space");
+
+		// Uploads complete in order, so the last one finishing means the mesh is resident
+		this->_upload->upload(*this->_vertexPool, this->_cubeMesh.vertices, CubeVerts, sizeof(CubeVerts));
+		this->_upload->upload(*this->_positionPool, this->_cubeMesh.positions, CubePositions.data(), sizeof(CubePositions));
+		this->_upload->upload(*this->_indexPool, this->_cubeMesh.indices, Indices, sizeof(Indices), [this]() { this->_cubeMesh.ready = true; });
+		// -------------------------------
+
+		// SCENE -------------------------
+		// Rows are added back to front on purpose, so unsorted submission is the worst case for early-Z
+		for (int z = 3; z >= 0; z--) {
+			for (int x = -1; x <= 1; x++) {
+				this->_cubes.push_back({Diligent::float3{static_cast<float>(x) * 1.5F, 0.F, static_cast<float>(z) * 2.5F}});
+			}
+		}
 
-		Diligent::BufferData IBData;
-		IBData.pData = Indices;
-		IBData.DataSize = sizeof(Indices);
-		this->_pDevice->CreateBuffer(IndBuffDesc, &IBData, &this->_CubeIndexBuffer);
+		this->_drawOrder.resize(this->_cubes.size());
 		// -------------------------------
 
 		this->_initialized = true;
 	}
 
+	void TestGame::streamTerrain() {
+		// STREAM OUT ---
+		if (this->_terrainStreamed) {
+			// Also cancels whatever part of it is still queued
+			this->_upload->release(*this->_vertexPool, this->_terrainMesh.vertices);
+			this->_upload->release(*this->_positionPool, this->_terrainMesh.positions);
+			this->_upload->release(*this->_indexPool, this->_terrainMesh.indices);
+
+			this->_terrainMesh = {};
+			this->_terrainStreamed = false;
+			return;
+		}
+		// --------------
+
+		// Pool usage the release has to come back to. Skipped while older releases are still pending, since they retire along with this one
+		if (this->_upload->pendingReleases() == 0) {
+			this->_poolUsedBeforeTerrain = std::array<uint64_t, 3>{this->_vertexPool->used(), this->_positionPool->used(), this->_indexPool->used()};
+		} else {
+			this->_poolUsedBeforeTerrain = std::nullopt;
+		}
+
+		// Procedural height field, big enough to take several frames of upload budget
+		constexpr uint32_t gridSize = 128;
+
+		std::vector<ColorVertex> vertices = {};
+		std::vector<Diligent::float3> positions = {};
+		std::vector<uint32_t> indices = {};
+
+		vertices.reserve(gridSize * gridSize);
+		positions.reserve(gridSize * gridSize);
+		indices.reserve((gridSize - 1) * (gridSize - 1) * 6);
+
+		for (uint32_t z = 0; z < gridSize; z++) {
+			for (uint32_t x = 0; x < gridSize; x++) {
+				const float fx = -6.F + 12.F * static_cast<float>(x) / static_cast<float>(gridSize - 1);
+				const float fz = -2.F + 14.F * static_cast<float>(z) / static_cast<float>(gridSize - 1);
+				const float height = std::sin(fx * 1.5F) * std::cos(fz * 1.5F);
+
+				const Diligent::float3 pos = {fx, -1.4F + 0.2F * height, fz};
+				vertices.push_back({pos, Diligent::float4{0.2F, 0.45F + 0.25F * height, 0.2F, 1.F}});
+				positions.push_back(pos);
+			}
+		}
+
+		for (uint32_t z = 0; z < gridSize - 1; z++) {
+			for (uint32_t x = 0; x < gridSize - 1; x++) {
+				const uint32_t v00 = z * gridSize + x;
+				const uint32_t v10 = v00 + 1;
+				const uint32_t v01 = v00 + gridSize;
+				const uint32_t v11 = v01 + 1;
+
+				// Clockwise when seen from above
+				indices.insert(indices.end(), {v00, v01, v11, v00, v11, v10});
+			}
+		}
+
+		this->_terrainMesh.vertices = this->_vertexPool->allocate(vertices.size());
+		this->_terrainMesh.positions = this->_positionPool->allocate(positions.size());
+		this->_terrainMesh.indices = this->_indexPool->allocate(indices.size());
+
+		if (!this->_terrainMesh.vertices.valid() || !this->_terrainMesh.positions.valid() || !this->_terrainMesh.indices.valid()) {
+			// Not enough pool space, give back whatever was allocated
+			this->_vertexPool->free(this->_terrainMesh.vertices);
+			this->_positionPool->free(this->_terrainMesh.positions);
+			this->_indexPool->free(this->_terrainMesh.indices);
+			this->_terrainMesh = {};
+			return;
+		}
+
+		this->_upload->upload(*this->_vertexPool, this->_terrainMesh.vertices, vertices.data(), vertices.size() * sizeof(ColorVertex));
+		this->_upload->upload(*this->_positionPool, this->_terrainMesh.positions, positions.data(), positions.size() * sizeof(Diligent::float3));
+		this->_upload->upload(*this->_indexPool, this->_terrainMesh.indices, indices.data(), indices.size() * sizeof(uint32_t), [this]() { this->_terrainMesh.ready = true; });
+
+		this->_terrainStreamed = true;
+	}
+
+	void TestGame::checkTerrainRelease() {
+		if (!this->_poolUsedBeforeTerrain.has_value() || this->_terrainStreamed || this->_upload->pendingReleases() != 0) return;
+
+		// Debug builds only, fragmentation is already shown in the title
+		VERIFY((std::array<uint64_t, 3>{this->_vertexPool->used(), this->_positionPool->used(), this->_indexPool->used()} == *this->_poolUsedBeforeTerrain), "Geometry pools leaked after streaming out the terrain");
+		this->_poolUsedBeforeTerrain = std::nullopt;
+	}
+
 	Diligent::float4x4 TestGame::GetSurfacePretransformMatrix(const Diligent::float3& f3CameraViewAxis) const {
 		const auto& SCDesc = this->_pSwapChain->GetDesc();
 
@@ -523,9 +715,6 @@ namespace test {
 			this->_lastUpdate = time;
 
 			if (this->_initialized) {
-				// Apply rotation
-				Diligent::float4x4 CubeModelTransform = Diligent::float4x4::RotationY(this->_counter * 1.0F) * Diligent::float4x4::RotationX(-Diligent::PI_F * 0.1F);
-
 				// Camera is at (0, 0, -5) looking along the Z axis
 				Diligent::float4x4 View = Diligent::float4x4::Translation(0.F, 0.0F, 5.0F);
 				// Get pretransform matrix that rotates the scene according the surface orientation
@@ -534,57 +723,176 @@ namespace test {
 				// Get projection matrix adjusted to the current screen orientation
 				auto Proj = GetAdjustedProjectionMatrix(Diligent::PI_F / 4.0F, 0.1F, 100.F);
 
-				// Compute world-view-projection matrix
-				this->_WorldViewProjMatrix = CubeModelTransform * View * SrfPreTransform * Proj;
+				auto ViewProj = View * SrfPreTransform * Proj;
+				this->_ViewProjMatrix = ViewProj;
 
+				if (this->_streamTerrain) {
+					this->_streamTerrain = false;
+					this->streamTerrain();
+				}
+
+				for (auto& cube : this->_cubes) {
+					// Apply rotation
+					Diligent::float4x4 CubeModelTransform = Diligent::float4x4::Scale(0.6F, 0.6F, 0.6F) * Diligent::float4x4::RotationY(this->_counter * 1.0F) * Diligent::float4x4::RotationX(-Diligent::PI_F * 0.1F) * Diligent::float4x4::Translation(cube.position);
+
+					// Compute world-view-projection matrix
+					cube.worldViewProj = CubeModelTransform * ViewProj;
+					cube.viewDepth = (Diligent::float4{cube.position, 1.F} * View).z;
+				}
+
+				this->sortOpaque();
 				this->draw();
+				this->updateStats(dt);
+				this->checkTerrainRelease();
 
 				this->_counter += 0.001F;
 			}
 		}
 	}
 
+	void TestGame::sortOpaque() {
+		for (size_t i = 0; i < this->_drawOrder.size(); i++)
+			this->_drawOrder[i] = i;
+
+		if (!this->_sortOpaque) return;
+
+		// Front to back, so early-Z rejects occluded pixels before they are shaded
+		std::sort(this->_drawOrder.begin(), this->_drawOrder.end(), [this](size_t a, size_t b) {
+			return this->_cubes[a].viewDepth < this->_cubes[b].viewDepth;
+		});
+	}
+
+	void TestGame::updateStats(float dt) {
+		const auto& upload = this->_upload->stats();
+
+		this->_statsFrames++;
+		this->_statsUploadBytes += upload.bytesLastFrame;
+		this->_statsUploadCopies += upload.copiesLastFrame;
+
+		this->_statsTimer += dt;
+		if (this->_statsTimer < 0.5F) return;
+		this->_statsTimer = 0.F;
+
+		std::string overdraw = "n/a";
+		if (this->_pPipelineStats != nullptr) {
+			const auto& SCDesc = this->_pSwapChain->GetDesc();
+			const double pixels = static_cast<double>(SCDesc.Width) * static_cast<double>(SCDesc.Height);
+
+			// Pixel shader invocations per screen pixel, lower is better
+			std::ostringstream ss;
+			ss << std::fixed << std::setprecision(3) << static_cast<double>(this->_psInvocations) / pixels;
+			overdraw = ss.str();
+		}
+
+		// Streaming, queue depth + average upload per frame + staging not consumed yet + worst pool fragmentation
+		const float fragmentation = std::max({this->_vertexPool->fragmentation(), this->_positionPool->fragmentation(), this->_indexPool->fragmentation()});
+
+		std::ostringstream streaming;
+		streaming << "queue: " << upload.queueDepth << " (" << upload.queuedBytes << " B) | uploaded: " << this->_statsUploadBytes / this->_statsFrames << " B/frame in " << std::fixed << std::setprecision(1) << static_cast<double>(this->_statsUploadCopies) / this->_statsFrames << " copies | staging in flight: " << upload.stagingInFlight << " B | frag: " << std::setprecision(2) << fragmentation << " | terrain: " << (this->_terrainMesh.ready ? "IN" : (this->_terrainStreamed ? "STREAMING" : "OUT"));
+
+		this->_statsFrames = 0;
+		this->_statsUploadBytes = 0;
+		this->_statsUploadCopies = 0;
+
+		const auto title = this->_title + " | prepass: " + (this->_depthPrepass ? "ON" : "OFF") + " | sort: " + (this->_sortOpaque ? "ON" : "OFF") + " | overdraw view: " + (this->_debugOverdraw ? "ON" : "OFF") + " | PS/pixel: " + overdraw + " | " + streaming.str();
+		glfwSetWindowTitle(GLFWHANDLE, title.c_str());
+	}
+
 	void TestGame::draw() {
 		// Let the engine perform required state transitions
 		auto* pRTV = this->_pSwapChain->GetCurrentBackBufferRTV();
 		auto* pDSV = this->_pSwapChain->GetDepthBufferDSV();
 
 		const std::array<float, 4> clearColor = {0.350F, 0.350F, 0.350F, 1.0F};
+		// The overdraw view accumulates on top of black
+		const std::array<float, 4> overdrawClearColor = {0.F, 0.F, 0.F, 1.0F};
+
+		// Stream pending geometry before anything reads it
+		this->_upload->flush();
+
+		// DEPTH PREPASS ---
+		if (this->_depthPrepass) {
+			this->_pImmediateContext->SetRenderTargets(0, nullptr, pDSV, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+			this->_pImmediateContext->ClearDepthStencil(pDSV, Diligent::CLEAR_DEPTH_FLAG, 1.F, 0, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+
+			this->_pImmediateContext->SetPipelineState(this->_pDepthPSO);
+			this->_pImmediateContext->CommitShaderResources(this->_pDepthSRB, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+			this->drawScene(true);
+		}
+		// -----------------
 
 		this->_pImmediateContext->SetRenderTargets(1, &pRTV, pDSV, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
 
 		// Clear the back buffer
-		this->_pImmediateContext->ClearRenderTarget(pRTV, clearColor.data(), Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
-		this->_pImmediateContext->ClearDepthStencil(pDSV, Diligent::CLEAR_DEPTH_FLAG, 1.F, 0, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
-
-		{
-			// Map the buffer and write current world-view-projection matrix
-			Diligent::MapHelper<Diligent::float4x4> CBConstants(this->_pImmediateContext, this->_VSConstants, Diligent::MAP_WRITE, Diligent::MAP_FLAG_DISCARD);
-			*CBConstants = this->_WorldViewProjMatrix.Transpose();
+		this->_pImmediateContext->ClearRenderTarget(pRTV, this->_debugOverdraw ? overdrawClearColor.data() : clearColor.data(), Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+		if (!this->_depthPrepass) this->_pImmediateContext->ClearDepthStencil(pDSV, Diligent::CLEAR_DEPTH_FLAG, 1.F, 0, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+
+		// Pick the color pass variant, after a prepass only the depth-equal surface gets shaded
+		Diligent::IPipelineState* pPSO = nullptr;
+		Diligent::IShaderResourceBinding* pSRB = nullptr;
+		if (this->_debugOverdraw) {
+			pPSO = this->_depthPrepass ? this->_pOverdrawEqualPSO : this->_pOverdrawPSO;
+			pSRB = this->_depthPrepass ? this->_pOverdrawEqualSRB : this->_pOverdrawSRB;
+		} else {
+			pPSO = this->_depthPrepass ? this->_pEqualPSO : this->_pPSO;
+			pSRB = this->_depthPrepass ? this->_pEqualSRB : this->_pSRB;
 		}
 
-		// Bind vertex and index buffers
-		const uint64_t offset = 0;
-		Diligent::IBuffer* pBuffs[] = {this->_CubeVertexBuffer};
-		this->_pImmediateContext->SetVertexBuffers(0, 1, pBuffs, &offset, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION, Diligent::SET_VERTEX_BUFFERS_FLAG_RESET);
-		this->_pImmediateContext->SetIndexBuffer(this->_CubeIndexBuffer, 0, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+		if (this->_pPipelineStats != nullptr) this->_pPipelineStats->Begin(this->_pImmediateContext);
 
 		// Set the pipeline state in the immediate context
-		this->_pImmediateContext->SetPipelineState(this->_pPSO);
+		this->_pImmediateContext->SetPipelineState(pPSO);
 
 		// Commit shader resources. RESOURCE_STATE_TRANSITION_MODE_TRANSITION mode
 		// makes sure that resources are transitioned to required states.
-		this->_pImmediateContext->CommitShaderResources(this->_pSRB, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+		this->_pImmediateContext->CommitShaderResources(pSRB, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+		this->drawScene(false);
+
+		if (this->_pPipelineStats != nullptr) {
+			// Results come back a few frames late, keep the last one until a new one is ready
+			Diligent::QueryDataPipelineStatistics stats;
+			if (this->_pPipelineStats->End(this->_pImmediateContext, &stats, sizeof(stats))) this->_psInvocations = stats.PSInvocations;
+		}
+
+		// RENDER ---
+		this->_pSwapChain->Present();
+	}
+
+	void TestGame::drawScene(bool positionOnly) {
+		// Bind the shared vertex and index pools
+		const uint64_t offset = 0;
+		const auto& pool = positionOnly ? this->_positionPool : this->_vertexPool;
+		Diligent::IBuffer* pBuffs[] = {pool->buffer()};
+		this->_pImmediateContext->SetVertexBuffers(0, 1, pBuffs, &offset, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION, Diligent::SET_VERTEX_BUFFERS_FLAG_RESET);
+		this->_pImmediateContext->SetIndexBuffer(this->_indexPool->buffer(), 0, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+
+		for (auto index : this->_drawOrder)
+			this->drawMesh(this->_cubeMesh, this->_cubes[index].worldViewProj, positionOnly);
+
+		// Covers most of the screen behind the cubes, so it goes last
+		this->drawMesh(this->_terrainMesh, this->_ViewProjMatrix, positionOnly);
+	}
+
+	void TestGame::drawMesh(const Mesh& mesh, const Diligent::float4x4& worldViewProj, bool positionOnly) {
+		if (!mesh.ready) return;
+
+		{
+			// Map the buffer and write current world-view-projection matrix
+			Diligent::MapHelper<Diligent::float4x4> CBConstants(this->_pImmediateContext, this->_VSConstants, Diligent::MAP_WRITE, Diligent::MAP_FLAG_DISCARD);
+			*CBConstants = worldViewProj.Transpose();
+		}
+
+		const auto& vertices = positionOnly ? mesh.positions : mesh.vertices;
 
 		Diligent::DrawIndexedAttribs DrawAttrs;    // This is an indexed draw call
 		DrawAttrs.IndexType = Diligent::VT_UINT32; // Index type
-		DrawAttrs.NumIndices = 36;
+		DrawAttrs.NumIndices = static_cast<uint32_t>(mesh.indices.size);
+		// Locate the mesh inside the pools
+		DrawAttrs.FirstIndexLocation = static_cast<uint32_t>(mesh.indices.offset);
+		DrawAttrs.BaseVertex = static_cast<uint32_t>(vertices.offset);
 		// Verify the state of vertex and index buffers
 		DrawAttrs.Flags = Diligent::DRAW_FLAG_VERIFY_ALL;
 		this->_pImmediateContext->DrawIndexed(DrawAttrs);
-
-		// RENDER ---
-		this->_pSwapChain->Present();
 	}
 
 	void TestGame::shutdown() {
@@ -0,0 +1,255 @@
+#include <test/upload.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace test {
+	// BUFFER POOL ---------------------------------------
+	BufferPool::BufferPool(Diligent::IRenderDevice* device, const char* name, Diligent::BIND_FLAGS bindFlags, uint32_t stride, uint64_t capacity) : _stride(stride), _capacity(capacity) {
+		if (stride == 0 || capacity == 0) throw std::runtime_error("Invalid buffer pool size");
+
+		// Filled by CopyBuffer only, so it can live in device local memory
+		Diligent::BufferDesc BuffDesc;
+		BuffDesc.Name = name;
+		BuffDesc.Usage = Diligent::USAGE_DEFAULT;
+		BuffDesc.BindFlags = bindFlags;
+		BuffDesc.Size = capacity * stride;
+
+		device->CreateBuffer(BuffDesc, nullptr, &this->_buffer);
+		if (this->_buffer == nullptr) throw std::runtime_error(std::string("Failed to create ") + name);
+
+		this->_free[0] = capacity;
+	}
+
+	BufferRange BufferPool::allocate(uint64_t count) {
+		if (count == 0) return {};
+
+		for (auto it = this->_free.begin(); it != this->_free.end(); ++it) {
+			if (it->second < count) continue;
+
+			const BufferRange range = {it->first, count};
+			const uint64_t remaining = it->second - count;
+
+			this->_free.erase(it);
+			if (remaining > 0) this->_free[range.offset + count] = remaining;
+
+			this->_used += count;
+			return range;
+		}
+
+		return {};
+	}
+
+	void BufferPool::free(const BufferRange& range) {
+		if (!range.valid()) return;
+		if (range.offset >= this->_capacity || range.size > this->_capacity - range.offset) throw std::runtime_error("Freed range is outside of the buffer pool");
+
+		uint64_t offset = range.offset;
+		uint64_t size = range.size;
+
+		// A free block starting inside the range means a double free or a bad range
+		auto next = this->_free.lower_bound(offset);
+		if (next != this->_free.end() && next->first < offset + size) throw std::runtime_error("Freed range overlaps a free block");
+
+		auto prev = next;
+		if (prev != this->_free.begin()) {
+			--prev;
+			if (prev->first + prev->second > offset) throw std::runtime_error("Freed range overlaps a free block");
+		} else {
+			prev = this->_free.end();
+		}
+
+		// Merge with the next free block
+		if (next != this->_free.end() && next->first == offset + size) {
+			size += next->second;
+			this->_free.erase(next);
+		}
+
+		// Merge with the previous free block
+		if (prev != this->_free.end() && prev->first + prev->second == offset) {
+			offset = prev->first;
+			size += prev->second;
+			this->_free.erase(prev);
+		}
+
+		this->_free[offset] = size;
+		this->_used -= range.size;
+	}
+
+	float BufferPool::fragmentation() const {
+		uint64_t total = 0;
+		uint64_t largest = 0;
+
+		for (const auto& block : this->_free) {
+			total += block.second;
+			largest = std::max(largest, block.second);
+		}
+
+		if (total == 0) return 0.F;
+		return 1.F - static_cast<float>(largest) / static_cast<float>(total);
+	}
+	// ---------------------------------------------------
+
+	// UPLOAD MANAGER ------------------------------------
+	UploadManager::UploadManager(Diligent::IRenderDevice* device, Diligent::IDeviceContext* context, uint64_t frameBudget, uint32_t framesInFlight) : _context(context), _frameBudget(frameBudget) {
+		if (frameBudget == 0 || framesInFlight == 0) throw std::runtime_error("Invalid upload manager size");
+
+		// How mapping a staging buffer behaves per backend:
+		// - Vulkan / D3D12: staging memory is persistently mapped, MapBuffer only returns the pointer.
+		// - D3D11: D3D11_MAP_WRITE waits while the GPU reads the resource. MAP_FLAG_DO_NOT_WAIT turns that
+		//   into a failed map, the frame is then skipped instead of stalling.
+		// - OpenGL: glMapBufferRange synchronizes with pending reads of the buffer.
+		// Only buffers whose fence already passed get mapped, so none of them has pending GPU work.
+		if (device->GetDeviceInfo().Type == Diligent::RENDER_DEVICE_TYPE_D3D11) this->_mapFlags = Diligent::MAP_FLAG_DO_NOT_WAIT;
+
+		this->_staging.resize(framesInFlight);
+		for (auto& staging : this->_staging) {
+			Diligent::BufferDesc StagingDesc;
+			StagingDesc.Name = "Upload staging buffer";
+			StagingDesc.Usage = Diligent::USAGE_STAGING;
+			StagingDesc.CPUAccessFlags = Diligent::CPU_ACCESS_WRITE;
+			StagingDesc.Size = frameBudget;
+
+			device->CreateBuffer(StagingDesc, nullptr, &staging.buffer);
+			if (staging.buffer == nullptr) throw std::runtime_error("Failed to create upload staging buffer");
+		}
+
+		Diligent::FenceDesc FncDesc;
+		FncDesc.Name = "Upload fence";
+
+		device->CreateFence(FncDesc, &this->_fence);
+		if (this->_fence == nullptr) throw std::runtime_error("Failed to create upload fence");
+	}
+
+	void UploadManager::upload(Diligent::IBuffer* dst, uint64_t dstOffset, const void* data, uint64_t size, std::function<void()> onComplete) {
+		if (dst == nullptr || data == nullptr || size == 0) throw std::runtime_error("Invalid upload");
+
+		PendingUpload pending;
+		pending.dst = dst;
+		pending.dstOffset = dstOffset;
+		pending.data.resize(size);
+		pending.onComplete = std::move(onComplete);
+		std::memcpy(pending.data.data(), data, size);
+
+		this->_stats.queuedBytes += size;
+		this->_queue.push_back(std::move(pending));
+		this->_stats.queueDepth = this->_queue.size();
+	}
+
+	void UploadManager::upload(const BufferPool& pool, const BufferRange& range, const void* data, uint64_t size, std::function<void()> onComplete) {
+		if (size != range.size * pool.stride()) throw std::runtime_error("Upload size does not match the pool range");
+		this->upload(pool.buffer(), range.offset * pool.stride(), data, size, std::move(onComplete));
+	}
+
+	void UploadManager::release(BufferPool& pool, const BufferRange& range) {
+		if (!range.valid()) return;
+
+		// Drop uploads still targeting the range, they would otherwise overwrite whoever allocates it next
+		const uint64_t begin = range.offset * pool.stride();
+		const uint64_t end = begin + range.size * pool.stride();
+
+		for (auto it = this->_queue.begin(); it != this->_queue.end();) {
+			const uint64_t dstEnd = it->dstOffset + it->data.size();
+			if (it->dst.RawPtr() == pool.buffer() && it->dstOffset < end && dstEnd > begin) {
+				this->_stats.queuedBytes -= it->data.size() - it->copied;
+				it = this->_queue.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		this->_stats.queueDepth = this->_queue.size();
+
+		// Copies already recorded and draws recorded this frame come before the next signal, so wait for it
+		this->_releases.push_back({this->_fenceValue + 1, &pool, range});
+	}
+
+	void UploadManager::retire() {
+		this->_completedValue = this->_fence->GetCompletedValue();
+
+		while (!this->_releases.empty() && this->_releases.front().fenceValue <= this->_completedValue) {
+			const auto& done = this->_releases.front();
+
+			done.pool->free(done.range);
+			this->_releases.pop_front();
+		}
+	}
+
+	uint8_t* UploadManager::mapStaging(StagingBuffer& staging) {
+		// Still read by the GPU, skip uploads this frame instead of waiting
+		if (staging.fenceValue > this->_completedValue) return nullptr;
+
+		void* pData = nullptr;
+		this->_context->MapBuffer(staging.buffer, Diligent::MAP_WRITE, this->_mapFlags, pData);
+		return static_cast<uint8_t*>(pData);
+	}
+
+	void UploadManager::flush() {
+		this->retire();
+
+		std::vector<std::function<void()>> completed = {};
+		auto& staging = this->_staging[this->_stagingIndex];
+		uint8_t* mapped = nullptr;
+		uint64_t written = 0;
+
+		this->_regions.clear();
+		if (!this->_queue.empty()) mapped = this->mapStaging(staging);
+
+		// Uploads are split into chunks, so big meshes spread over several frames
+		// instead of blowing the frame time
+		while (mapped != nullptr && !this->_queue.empty() && written < this->_frameBudget) {
+			auto& pending = this->_queue.front();
+
+			const uint64_t chunk = std::min(static_cast<uint64_t>(pending.data.size()) - pending.copied, this->_frameBudget - written);
+			std::memcpy(mapped + written, pending.data.data() + pending.copied, chunk);
+
+			// Merge with the previous copy when both source and destination are contiguous
+			const uint64_t dstOffset = pending.dstOffset + pending.copied;
+			auto* last = this->_regions.empty() ? nullptr : &this->_regions.back();
+			if (last != nullptr && last->dst == pending.dst.RawPtr() && last->dstOffset + last->size == dstOffset) {
+				last->size += chunk;
+			} else {
+				this->_regions.push_back({pending.dst.RawPtr(), written, dstOffset, chunk});
+			}
+
+			pending.copied += chunk;
+			written += chunk;
+
+			if (pending.copied == pending.data.size()) {
+				if (pending.onComplete != nullptr) completed.push_back(std::move(pending.onComplete));
+				this->_queue.pop_front();
+			}
+		}
+
+		if (mapped != nullptr) this->_context->UnmapBuffer(staging.buffer, Diligent::MAP_WRITE);
+
+		for (const auto& region : this->_regions) {
+			this->_context->CopyBuffer(staging.buffer, region.srcOffset, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION, region.dst, region.dstOffset, region.size, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+		}
+
+		// Signal every frame, even without copies, so deferred releases keep retiring
+		this->_context->EnqueueSignal(this->_fence, ++this->_fenceValue);
+		if (written > 0) {
+			staging.fenceValue = this->_fenceValue;
+			staging.bytes = written;
+			this->_stagingIndex = (this->_stagingIndex + 1) % this->_staging.size();
+		}
+
+		// STATS ---
+		this->_stats.queuedBytes -= written;
+		this->_stats.queueDepth = this->_queue.size();
+		this->_stats.bytesLastFrame = written;
+		this->_stats.copiesLastFrame = static_cast<uint32_t>(this->_regions.size());
+		this->_stats.stagingInFlight = 0;
+		for (const auto& buff : this->_staging) {
+			if (buff.fenceValue > this->_completedValue) this->_stats.stagingInFlight += buff.bytes;
+		}
+		// ---------
+
+		for (auto& fn : completed)
+			fn();
+	}
+	// ---------------------------------------------------
+} // namespace test